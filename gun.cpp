@@ -7,9 +7,33 @@
 #include <iostream>
 #include <termios.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <chrono>
 
 using namespace std;
 
+// Fixed-point world coordinates - 8 fractional bits
+#define FIX_SHIFT 8
+#define FIX_ONE (1 << FIX_SHIFT)
+#define TO_FIX(v) ((v) * FIX_ONE)
+#define FROM_FIX(v) ((v) >> FIX_SHIFT)
+
+// Playfield size in whole world units, independent of screen resolution
+struct World {
+    int width, height;
+    int minX() { return 40; }           // Movement bounds for gun and targets
+    int maxX() { return width - 40; }
+};
+
+World world = { 640, 480 };
+
 // Non-blocking keyboard input
 int kbhit() {
     struct termios oldt, newt;
@@ -35,14 +59,653 @@ int kbhit() {
     return 0;
 }
 
+// Tile size for parallel rasterization
+#define TILE_SIZE 64
+
+// How many recent batches a command may search back through to find its match
+#define BATCH_LOOKBACK 32
+
+// Primitive types recorded into the frame command buffer
+enum DrawType { DRAW_LINE, DRAW_CIRCLE, DRAW_PIXEL, DRAW_RECT };
+
+// One recorded draw call with its bounding box
+struct DrawCmd {
+    int type, color;
+    int x1, y1, x2, y2;          // Endpoints (circle: centre x1,y1 and radius x2)
+    int minX, minY, maxX, maxY;  // Bounding box used for tile binning
+};
+
+// Commands of one color and primitive type, flushed together
+struct DrawBatch {
+    int type, color;
+    int first, last;             // Chain of command indices through Renderer::link
+    int minX, minY, maxX, maxY;  // Union of member bounding boxes
+};
+
+// Per-frame rasterizer counters
+struct RenderStats {
+    int cmds;                 // Primitives rasterized, summed over all tiles
+    int calls;                // Typed raster calls rasterTile made for them
+    int colorChanges;         // Color switches in the order draw() recorded
+    int renderColorChanges;   // Color switches in the order tiles drew in
+};
+
+// Text is not rasterized - it is drawn by graphics.h on top of the frame
+struct TextCmd {
+    int x, y, color;
+    char text[64];
+};
+
+// Persistent worker threads that share out numbered jobs
+class ThreadPool {
+    vector<thread> workers;
+    mutex lock;
+    condition_variable wake, finished;
+    function<void(int)> job;
+    atomic<int> next;
+    int jobCount, busy;
+    unsigned generation;
+    bool quit;
+    
+    void work() {
+        int i;
+        while((i = next.fetch_add(1)) < jobCount) job(i);
+    }
+    
+    void workerLoop() {
+        unsigned seen = 0;
+        while(true) {
+            {
+                unique_lock<mutex> l(lock);
+                wake.wait(l, [&] { return quit || generation != seen; });
+                if(quit) return;
+                seen = generation;
+            }
+            work();
+            lock_guard<mutex> l(lock);
+            if(--busy == 0) finished.notify_one();
+        }
+    }
+    
+public:
+    ThreadPool(int threads) : next(0), jobCount(0), busy(0), generation(0), quit(false) {
+        // The calling thread works too, so start one less
+        for(int i = 1; i < threads; i++)
+            workers.push_back(thread(&ThreadPool::workerLoop, this));
+    }
+    
+    // Run fn(0) .. fn(count-1) on all threads and wait until done
+    void run(int count, const function<void(int)>& fn) {
+        {
+            lock_guard<mutex> l(lock);
+            job = fn;
+            jobCount = count;
+            next = 0;
+            busy = workers.size();
+            generation++;
+        }
+        wake.notify_all();
+        work();
+        unique_lock<mutex> l(lock);
+        finished.wait(l, [&] { return busy == 0; });
+    }
+    
+    int size() { return workers.size() + 1; }
+    
+    ~ThreadPool() {
+        {
+            lock_guard<mutex> l(lock);
+            quit = true;
+        }
+        wake.notify_all();
+        for(size_t i = 0; i < workers.size(); i++) workers[i].join();
+    }
+};
+
+// Offscreen framebuffer - draw calls are recorded, binned by bounding box
+// into tiles, and each tile is rasterized by one thread (no locks needed).
+// Draw calls take world units and are scaled to the output resolution.
+class Renderer {
+    int width, height, tilesX, tilesY;
+    int scale;                       // Output pixels per world unit, fixed-point
+    int offX, offY;                  // Letterbox offset to centre the world
+    int thick;                       // Stroke width in output pixels
+    vector<unsigned char> frame;     // One BGI color per pixel
+    vector<unsigned char> shrunk;    // Frame shrunk to the window, if larger
+    vector<DrawCmd> cmds;
+    vector<TextCmd> texts;
+    vector< vector<int> > bins;      // Command indices per tile, in batch order
+    vector<DrawBatch> batches;
+    vector<int> link;                // Next command in the same batch, or -1
+    vector<int> order;               // Command indices in the order tiles draw them
+    vector<int> tileCalls;           // Raster calls made by each tile this frame
+    bool batching;
+    RenderStats stats, totals;
+    int frames;
+    int curColor;
+    ThreadPool pool;
+    
+    // World units to output pixels
+    int sx(int wx) { return offX + FROM_FIX((long long)wx * scale); }
+    int sy(int wy) { return offY + FROM_FIX((long long)wy * scale); }
+    int ss(int len) { return FROM_FIX((long long)len * scale); }
+    
+    void add(int type, int color, int x1, int y1, int x2, int y2,
+             int minX, int minY, int maxX, int maxY) {
+        // Grow the box by the stroke width so binning covers thick strokes
+        DrawCmd c = { type, color, x1, y1, x2, y2,
+                      minX - thick, minY - thick, maxX + thick, maxY + thick };
+        cmds.push_back(c);
+    }
+    
+    // Tile clip rectangle is [x0, x1) x [y0, y1)
+    void plot(int x, int y, int color, int x0, int y0, int x1, int y1) {
+        if(x >= x0 && x < x1 && y >= y0 && y < y1)
+            frame[y * width + x] = color;
+    }
+    
+    // A thick x thick block, so lines keep their weight when scaled up
+    void stamp(int x, int y, int color, int x0, int y0, int x1, int y1) {
+        if(thick == 1) {
+            plot(x, y, color, x0, y0, x1, y1);
+            return;
+        }
+        int bx = x - thick / 2, by = y - thick / 2;
+        for(int py = max(by, y0); py < min(by + thick, y1); py++)
+            for(int px = max(bx, x0); px < min(bx + thick, x1); px++)
+                frame[py * width + px] = color;
+    }
+    
+    void rasterLine(int ax, int ay, int bx, int by, int color, int x0, int y0, int x1, int y1) {
+        // Bresenham
+        int x = ax, y = ay;
+        int dx = abs(bx - ax), sx = ax < bx ? 1 : -1;
+        int dy = -abs(by - ay), sy = ay < by ? 1 : -1;
+        int err = dx + dy;
+        while(true) {
+            stamp(x, y, color, x0, y0, x1, y1);
+            if(x == bx && y == by) break;
+            int e2 = 2 * err;
+            if(e2 >= dy) { err += dy; x += sx; }
+            if(e2 <= dx) { err += dx; y += sy; }
+        }
+    }
+    
+    void rasterCircle(const DrawCmd& c, int color, int x0, int y0, int x1, int y1) {
+        // A ring thick pixels wide, so stacked circles still fill solidly
+        for(int r = c.x2; r > c.x2 - thick && r >= 0; r--)
+            rasterRing(c.x1, c.y1, r, color, x0, y0, x1, y1);
+    }
+    
+    void rasterRing(int cx, int cy, int radius, int color, int x0, int y0, int x1, int y1) {
+        // Midpoint circle, 8-way symmetry
+        int px = radius, py = 0, err = 1 - radius;
+        while(px >= py) {
+            plot(cx + px, cy + py, color, x0, y0, x1, y1);
+            plot(cx - px, cy + py, color, x0, y0, x1, y1);
+            plot(cx + px, cy - py, color, x0, y0, x1, y1);
+            plot(cx - px, cy - py, color, x0, y0, x1, y1);
+            plot(cx + py, cy + px, color, x0, y0, x1, y1);
+            plot(cx - py, cy + px, color, x0, y0, x1, y1);
+            plot(cx + py, cy - px, color, x0, y0, x1, y1);
+            plot(cx - py, cy - px, color, x0, y0, x1, y1);
+            py++;
+            if(err < 0) {
+                err += 2 * py + 1;
+            } else {
+                px--;
+                err += 2 * (py - px) + 1;
+            }
+        }
+    }
+    
+    // Typed batch calls - one per run of same-color, same-type commands
+    void rasterLines(const int* idx, int n, int color, int x0, int y0, int x1, int y1) {
+        for(int i = 0; i < n; i++) {
+            const DrawCmd& c = cmds[idx[i]];
+            rasterLine(c.x1, c.y1, c.x2, c.y2, color, x0, y0, x1, y1);
+        }
+    }
+    
+    void rasterCircles(const int* idx, int n, int color, int x0, int y0, int x1, int y1) {
+        for(int i = 0; i < n; i++)
+            rasterCircle(cmds[idx[i]], color, x0, y0, x1, y1);
+    }
+    
+    void rasterPixels(const int* idx, int n, int color, int x0, int y0, int x1, int y1) {
+        for(int i = 0; i < n; i++)
+            stamp(cmds[idx[i]].x1, cmds[idx[i]].y1, color, x0, y0, x1, y1);
+    }
+    
+    void rasterRects(const int* idx, int n, int color, int x0, int y0, int x1, int y1) {
+        for(int i = 0; i < n; i++) {
+            const DrawCmd& c = cmds[idx[i]];
+            rasterLine(c.x1, c.y1, c.x2, c.y1, color, x0, y0, x1, y1);  // Top
+            rasterLine(c.x1, c.y2, c.x2, c.y2, color, x0, y0, x1, y1);  // Bottom
+            rasterLine(c.x1, c.y1, c.x1, c.y2, color, x0, y0, x1, y1);  // Left
+            rasterLine(c.x2, c.y1, c.x2, c.y2, color, x0, y0, x1, y1);  // Right
+        }
+    }
+    
+    void rasterTile(int t) {
+        int x0 = (t % tilesX) * TILE_SIZE, y0 = (t / tilesX) * TILE_SIZE;
+        int x1 = min(x0 + TILE_SIZE, width), y1 = min(y0 + TILE_SIZE, height);
+        
+        // Each tile clears its own pixels
+        for(int y = y0; y < y1; y++)
+            memset(&frame[y * width + x0], BLACK, x1 - x0);
+        
+        // Flush each run of same-type, same-color commands in one call
+        const vector<int>& bin = bins[t];
+        size_t i = 0;
+        int calls = 0;
+        while(i < bin.size()) {
+            const DrawCmd& first = cmds[bin[i]];
+            size_t j = i + 1;
+            while(j < bin.size() && cmds[bin[j]].type == first.type && cmds[bin[j]].color == first.color)
+                j++;
+            
+            const int* idx = &bin[i];
+            int n = j - i;
+            switch(first.type) {
+            case DRAW_LINE:   rasterLines(idx, n, first.color, x0, y0, x1, y1); break;
+            case DRAW_CIRCLE: rasterCircles(idx, n, first.color, x0, y0, x1, y1); break;
+            case DRAW_PIXEL:  rasterPixels(idx, n, first.color, x0, y0, x1, y1); break;
+            case DRAW_RECT:   rasterRects(idx, n, first.color, x0, y0, x1, y1); break;
+            }
+            calls++;
+            i = j;
+        }
+        tileCalls[t] = calls;
+    }
+    
+    static bool overlaps(const DrawBatch& b, const DrawCmd& c) {
+        return c.minX <= b.maxX && c.maxX >= b.minX && c.minY <= b.maxY && c.maxY >= b.minY;
+    }
+    
+    // Group commands into batches of one color and primitive type. A command
+    // only moves back past batches it does not overlap, so every pixel ends
+    // up the same color as when drawing in the original order.
+    void batchCommands() {
+        int n = cmds.size();
+        batches.clear();
+        link.resize(n);
+        
+        for(int i = 0; i < n; i++) {
+            const DrawCmd& c = cmds[i];
+            link[i] = -1;
+            
+            int target = -1;
+            int stop = max(0, (int)batches.size() - BATCH_LOOKBACK);
+            for(int b = (int)batches.size() - 1; b >= stop; b--) {
+                if(batches[b].type == c.type && batches[b].color == c.color) {
+                    target = b;
+                    break;
+                }
+                if(overlaps(batches[b], c)) break;
+            }
+            
+            if(target < 0) {
+                DrawBatch nb = { c.type, c.color, i, i, c.minX, c.minY, c.maxX, c.maxY };
+                batches.push_back(nb);
+            } else {
+                DrawBatch& b = batches[target];
+                link[b.last] = i;
+                b.last = i;
+                b.minX = min(b.minX, c.minX);
+                b.minY = min(b.minY, c.minY);
+                b.maxX = max(b.maxX, c.maxX);
+                b.maxY = max(b.maxY, c.maxY);
+            }
+        }
+        
+        order.clear();
+        for(size_t b = 0; b < batches.size(); b++)
+            for(int i = batches[b].first; i >= 0; i = link[i])
+                order.push_back(i);
+    }
+    
+    void countStats() {
+        stats.cmds = stats.calls = 0;
+        for(size_t t = 0; t < bins.size(); t++) {
+            stats.cmds += bins[t].size();
+            stats.calls += tileCalls[t];
+        }
+        stats.colorChanges = stats.renderColorChanges = 0;
+        for(size_t i = 0; i < cmds.size(); i++)
+            if(i == 0 || cmds[i].color != cmds[i - 1].color) stats.colorChanges++;
+        for(size_t k = 0; k < order.size(); k++)
+            if(k == 0 || cmds[order[k]].color != cmds[order[k - 1]].color) stats.renderColorChanges++;
+        
+        totals.cmds += stats.cmds;
+        totals.calls += stats.calls;
+        totals.colorChanges += stats.colorChanges;
+        totals.renderColorChanges += stats.renderColorChanges;
+        frames++;
+    }
+    
+public:
+    Renderer(int w, int h, int threads, int worldW, int worldH)
+        : width(w), height(h),
+          tilesX((w + TILE_SIZE - 1) / TILE_SIZE), tilesY((h + TILE_SIZE - 1) / TILE_SIZE),
+          frame(w * h), bins(tilesX * tilesY), tileCalls(tilesX * tilesY), batching(false),
+          frames(0), curColor(WHITE),
+          pool(min(threads, tilesX * tilesY)) {  // More threads than tiles would idle
+        memset(&stats, 0, sizeof(stats));
+        memset(&totals, 0, sizeof(totals));
+        // Uniform scale that fits the whole world on screen
+        scale = max(1, min(TO_FIX(w) / worldW, TO_FIX(h) / worldH));
+        offX = (w - ss(worldW)) / 2;
+        offY = (h - ss(worldH)) / 2;
+        thick = max(1, FROM_FIX(scale + FIX_ONE - 1));  // Round up so rings overlap rather than leave gaps
+    }
+    
+    // Start a new frame
+    void begin() {
+        cmds.clear();
+        texts.clear();
+    }
+    
+    // Same calls as graphics.h, but recorded instead of drawn
+    void setcolor(int c) { curColor = c; }
+    
+    void line(int x1, int y1, int x2, int y2) {
+        x1 = sx(x1); y1 = sy(y1); x2 = sx(x2); y2 = sy(y2);
+        add(DRAW_LINE, curColor, x1, y1, x2, y2,
+            min(x1, x2), min(y1, y2), max(x1, x2), max(y1, y2));
+    }
+    
+    void circle(int x, int y, int r) {
+        x = sx(x); y = sy(y); r = ss(r);
+        add(DRAW_CIRCLE, curColor, x, y, r, 0, x - r, y - r, x + r, y + r);
+    }
+    
+    void putpixel(int x, int y, int color) {
+        x = sx(x); y = sy(y);
+        add(DRAW_PIXEL, color, x, y, 0, 0, x, y, x, y);
+    }
+    
+    void rectangle(int x1, int y1, int x2, int y2) {
+        x1 = sx(x1); y1 = sy(y1); x2 = sx(x2); y2 = sy(y2);
+        add(DRAW_RECT, curColor, x1, y1, x2, y2,
+            min(x1, x2), min(y1, y2), max(x1, x2), max(y1, y2));
+    }
+    
+    void outtextxy(int x, int y, const char* text) {
+        TextCmd t;
+        t.x = sx(x);
+        t.y = sy(y);
+        t.color = curColor;
+        strncpy(t.text, text, sizeof(t.text) - 1);
+        t.text[sizeof(t.text) - 1] = 0;
+        texts.push_back(t);
+    }
+    
+    // Bin commands by bounding box and rasterize all tiles in parallel
+    void render() {
+        if(batching) {
+            batchCommands();
+        } else {
+            order.resize(cmds.size());
+            for(size_t i = 0; i < order.size(); i++) order[i] = i;
+        }
+        for(size_t t = 0; t < bins.size(); t++) bins[t].clear();
+        
+        for(size_t k = 0; k < order.size(); k++) {
+            int i = order[k];
+            const DrawCmd& c = cmds[i];
+            if(c.maxX < 0 || c.maxY < 0 || c.minX >= width || c.minY >= height) continue;
+            int tx0 = max(c.minX, 0) / TILE_SIZE, tx1 = min(c.maxX, width - 1) / TILE_SIZE;
+            int ty0 = max(c.minY, 0) / TILE_SIZE, ty1 = min(c.maxY, height - 1) / TILE_SIZE;
+            for(int ty = ty0; ty <= ty1; ty++)
+                for(int tx = tx0; tx <= tx1; tx++)
+                    bins[ty * tilesX + tx].push_back(i);
+        }
+        
+        pool.run(bins.size(), [this](int t) { rasterTile(t); });
+        countStats();
+    }
+    
+    // Hand every lit pixel inside w x h to put(x, y, color)
+    template<class Put> void blit(Put put, int w, int h) {
+        for(int y = 0; y < h; y++) {
+            const unsigned char* row = &frame[y * width];
+            for(int x = 0; x < w; x++)
+                if(row[x] != BLACK) put(x, y, row[x]);
+        }
+    }
+    
+    // Copy the finished frame to the screen, then draw text on top
+    void present() {
+        int winW = getmaxx() + 1, winH = getmaxy() + 1;
+        int step = FIX_ONE;  // Frame pixels per window pixel, fixed-point
+        int ox = 0, oy = 0;  // Centres the frame in the window
+        
+        if(width <= winW && height <= winH) {
+            // Frames that fit are shown 1:1
+            ox = (winW - width) / 2;
+            oy = (winH - height) / 2;
+            blit([&](int x, int y, int c) { ::putpixel(ox + x, oy + y, c); }, width, height);
+        } else {
+            // Frames bigger than the window (e.g. a 4K capture) are shrunk
+            // to fit. A window pixel is lit if any frame pixel under it is,
+            // so thin strokes are not lost between samples.
+            step = max(TO_FIX(width) / winW, TO_FIX(height) / winH);
+            ox = max(0, (winW - TO_FIX(width) / step) / 2);
+            oy = max(0, (winH - TO_FIX(height) / step) / 2);
+            shrunk.assign(winW * winH, BLACK);
+            for(int y = 0; y < height; y++) {
+                const unsigned char* row = &frame[y * width];
+                unsigned char* out = &shrunk[min(winH - 1, oy + TO_FIX(y) / step) * winW];
+                for(int x = 0; x < width; x++)
+                    if(row[x] != BLACK) out[min(winW - 1, ox + TO_FIX(x) / step)] = row[x];
+            }
+            for(int y = 0; y < winH; y++)
+                for(int x = 0; x < winW; x++)
+                    if(shrunk[y * winW + x] != BLACK) ::putpixel(x, y, shrunk[y * winW + x]);
+        }
+        
+        int color = -1;
+        for(size_t i = 0; i < texts.size(); i++) {
+            if(texts[i].color != color) {
+                color = texts[i].color;
+                ::setcolor(color);
+            }
+            ::outtextxy(ox + TO_FIX(texts[i].x) / step, oy + TO_FIX(texts[i].y) / step, texts[i].text);
+        }
+    }
+    
+    int getWidth() { return width; }
+    int getHeight() { return height; }
+    int getThreads() { return pool.size(); }
+    const RenderStats& getStats() { return stats; }
+    
+    // Batching reorders commands by color and type before binning. Colors are
+    // passed with every raster call, so it only cuts dispatch, not drawing work.
+    void setBatching(bool on) { batching = on; }
+    
+    // Average per-frame counters since the renderer was created
+    void printStats() {
+        if(frames == 0) return;
+        fprintf(stderr, "Render (batching %s): %.1f primitives in %.1f raster calls, "
+                "%.1f -> %.1f color changes per frame\n", batching ? "on" : "off",
+                (double)totals.cmds / frames, (double)totals.calls / frames,
+                (double)totals.colorChanges / frames, (double)totals.renderColorChanges / frames);
+    }
+    const unsigned char* getFrame() { return &frame[0]; }
+    
+    // Trade the finished frame for another buffer of the same size, which
+    // the next render() clears and draws over
+    bool swapFrame(vector<unsigned char>& other) {
+        if(other.size() != frame.size()) return false;
+        frame.swap(other);
+        return true;
+    }
+};
+
+// Number of reusable frame buffers between the game and the capture writer
+#define CAPTURE_SLOTS 4
+
+// BGI palette as RGB, used when writing captured frames
+const unsigned char bgiPalette[16][3] = {
+    {0, 0, 0}, {0, 0, 170}, {0, 170, 0}, {0, 170, 170},
+    {170, 0, 0}, {170, 0, 170}, {170, 85, 0}, {170, 170, 170},
+    {85, 85, 85}, {85, 85, 255}, {85, 255, 85}, {85, 255, 255},
+    {255, 85, 85}, {255, 85, 255}, {255, 255, 85}, {255, 255, 255}
+};
+
+// Streams rendered frames to a file or pipe from a background thread.
+// The game copies each frame into a free ring slot; when the writer falls
+// behind and no slot is free the frame is dropped instead of waiting.
+class FrameCapture {
+    int width, height;
+    bool y4m;                                   // Y4M (4:4:4) or raw RGB24
+    FILE* out;
+    bool isPipe;
+    vector<unsigned char> slots[CAPTURE_SLOTS]; // Frames as BGI color indices
+    vector<unsigned char> converted;            // Writer's RGB/YUV scratch
+    unsigned char yuv[16][3];                   // Palette converted to YUV
+    int head, tail, count;                      // Game fills head, writer drains tail
+    mutex lock;
+    condition_variable ready;
+    bool quit;
+    bool failed;                                // Output closed or write error
+    thread writer;
+    int written;                                // Only touched by the writer
+    int submitted, dropped;
+    double totalMs, worstMs;                    // Time spent in submit()
+    
+    // Returns false if the output could not take the whole frame
+    bool writeFrame(const unsigned char* frame) {
+        int n = width * height;
+        if(y4m) {
+            // Planar Y, U, V
+            if(fputs("FRAME\n", out) == EOF) return false;
+            for(int p = 0; p < 3; p++)
+                for(int i = 0; i < n; i++)
+                    converted[p * n + i] = yuv[frame[i]][p];
+        } else {
+            for(int i = 0; i < n; i++) {
+                const unsigned char* rgb = bgiPalette[frame[i]];
+                converted[i * 3] = rgb[0];
+                converted[i * 3 + 1] = rgb[1];
+                converted[i * 3 + 2] = rgb[2];
+            }
+        }
+        return fwrite(&converted[0], 1, converted.size(), out) == converted.size();
+    }
+    
+    void writerLoop() {
+        while(true) {
+            int slot;
+            {
+                unique_lock<mutex> l(lock);
+                ready.wait(l, [&] { return quit || count > 0; });
+                if(count == 0) return;  // Quit with nothing left to write
+                slot = tail;
+            }
+            bool ok = writeFrame(&slots[slot][0]);
+            lock_guard<mutex> l(lock);
+            if(!ok) {
+                // Stop capturing - submit() sees this and stops taking frames
+                failed = true;
+                return;
+            }
+            written++;
+            tail = (tail + 1) % CAPTURE_SLOTS;
+            count--;
+        }
+    }
+    
+public:
+    // A path starting with '|' is run as a command and frames are piped to it.
+    // Output is Y4M unless the path ends in ".rgb".
+    FrameCapture(const char* path, int w, int h)
+        : width(w), height(h), out(NULL), isPipe(path[0] == '|'), converted(w * h * 3),
+          head(0), tail(0), count(0), quit(false), failed(false), written(0),
+          submitted(0), dropped(0), totalMs(0), worstMs(0) {
+        size_t len = strlen(path);
+        y4m = !(len >= 4 && !strcmp(path + len - 4, ".rgb"));
+        // A capture command that exits early must not kill the game with
+        // SIGPIPE - the failed write is handled instead
+        signal(SIGPIPE, SIG_IGN);
+        out = isPipe ? popen(path + 1, "w") : fopen(path, "wb");
+        if(!out) {
+            failed = true;
+            return;
+        }
+        
+        for(int i = 0; i < CAPTURE_SLOTS; i++) slots[i].resize(w * h);
+        
+        // BT.601 RGB to YCbCr
+        for(int c = 0; c < 16; c++) {
+            int r = bgiPalette[c][0], g = bgiPalette[c][1], b = bgiPalette[c][2];
+            yuv[c][0] = (66 * r + 129 * g + 25 * b + 128) / 256 + 16;
+            yuv[c][1] = (-38 * r - 74 * g + 112 * b + 128) / 256 + 128;
+            yuv[c][2] = (112 * r - 94 * g - 18 * b + 128) / 256 + 128;
+        }
+        if(y4m) fprintf(out, "YUV4MPEG2 W%d H%d F25:1 Ip A1:1 C444\n", w, h);
+        
+        writer = thread(&FrameCapture::writerLoop, this);
+    }
+    
+    bool isOpen() { return out != NULL; }
+    
+    // Hand the renderer's finished frame to the writer by swapping it with
+    // the free head slot - no copy, and never blocks on file output
+    void submit(Renderer& r) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        int slot = -1;
+        {
+            lock_guard<mutex> l(lock);
+            if(failed) return;
+            if(count < CAPTURE_SLOTS) slot = head;
+        }
+        submitted++;
+        
+        // The head slot belongs to the game until count is raised
+        if(slot < 0 || !r.swapFrame(slots[slot])) {
+            dropped++;
+        } else {
+            {
+                lock_guard<mutex> l(lock);
+                head = (head + 1) % CAPTURE_SLOTS;
+                count++;
+            }
+            ready.notify_one();
+        }
+        
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        totalMs += ms;
+        if(ms > worstMs) worstMs = ms;
+    }
+    
+    ~FrameCapture() {
+        if(!out) return;
+        {
+            lock_guard<mutex> l(lock);
+            quit = true;
+        }
+        ready.notify_one();
+        writer.join();
+        
+        if(isPipe) pclose(out);
+        else fclose(out);
+        
+        fprintf(stderr, "Capture: %d frames written, %d dropped, submit avg %.3f ms, worst %.3f ms\n",
+                written, dropped, submitted ? totalMs / submitted : 0.0, worstMs);
+        if(failed) fprintf(stderr, "Capture: stopped early - could not write to the output\n");
+    }
+};
+
 // Abstract Base class for all game objects
 class GameObject {
 protected:
-    int x, y;
+    int x, y;  // Fixed-point world position
     bool active;
 public:
     GameObject(int x1, int y1) : x(x1), y(y1), active(true) {}
-    virtual void draw() = 0;  // Pure virtual function
+    virtual void draw(Renderer& r) = 0;  // Pure virtual function
     virtual void update() = 0;
     int getX() { return x; }
     int getY() { return y; }
@@ -58,34 +721,35 @@ private:
 public:
     Gun(int x1, int y1) : GameObject(x1, y1), lives(3) {}
     
-    void draw() {
+    void draw(Renderer& r) {
+        int wx = FROM_FIX(x), wy = FROM_FIX(y);
         // Gun turret - triangular shape
-        setcolor(CYAN);
-        line(x, y-35, x-15, y);
-        line(x, y-35, x+15, y);
-        line(x-15, y, x+15, y);
+        r.setcolor(CYAN);
+        r.line(wx, wy-35, wx-15, wy);
+        r.line(wx, wy-35, wx+15, wy);
+        r.line(wx-15, wy, wx+15, wy);
         
         // Gun base - wider platform
-        setcolor(LIGHTGRAY);
-        line(x-20, y, x+20, y);
-        line(x-20, y, x-18, y+5);
-        line(x+20, y, x+18, y+5);
-        line(x-18, y+5, x+18, y+5);
+        r.setcolor(LIGHTGRAY);
+        r.line(wx-20, wy, wx+20, wy);
+        r.line(wx-20, wy, wx-18, wy+5);
+        r.line(wx+20, wy, wx+18, wy+5);
+        r.line(wx-18, wy+5, wx+18, wy+5);
         
         // Gun barrel
-        setcolor(DARKGRAY);
-        line(x-3, y-15, x-3, y-35);
-        line(x+3, y-15, x+3, y-35);
+        r.setcolor(DARKGRAY);
+        r.line(wx-3, wy-15, wx-3, wy-35);
+        r.line(wx+3, wy-15, wx+3, wy-35);
         
         // Wheels
-        setcolor(WHITE);
-        circle(x-12, y+8, 3);
-        circle(x+12, y+8, 3);
+        r.setcolor(WHITE);
+        r.circle(wx-12, wy+8, 3);
+        r.circle(wx+12, wy+8, 3);
     }
     
     void update() {}
-    void moveLeft() { if(x > 40) x -= 15; }
-    void moveRight() { if(x < 600) x += 15; }
+    void moveLeft() { if(x > TO_FIX(world.minX())) x -= TO_FIX(15); }
+    void moveRight() { if(x < TO_FIX(world.maxX())) x += TO_FIX(15); }
     
     int getLives() { return lives; }
     void loseLife() { lives--; }
@@ -97,17 +761,18 @@ class Bullet : public GameObject {
 public:
     Bullet(int x1, int y1) : GameObject(x1, y1) {}
     
-    void draw() {
-        setcolor(YELLOW);
-        circle(x, y, 4);
+    void draw(Renderer& r) {
+        int wx = FROM_FIX(x), wy = FROM_FIX(y);
+        r.setcolor(YELLOW);
+        r.circle(wx, wy, 4);
         
         // Bullet trail
-        setcolor(WHITE);
-        circle(x, y+5, 2);
+        r.setcolor(WHITE);
+        r.circle(wx, wy+5, 2);
     }
     
     void update() {
-        y -= 15;
+        y -= TO_FIX(15);
         if(y < 0) active = false;
     }
 };
@@ -115,45 +780,45 @@ public:
 // Base Target class - demonstrates inheritance hierarchy
 class Target : public GameObject {
 protected:
-    int dir, speed, color, points, radius;
+    int speed, vx, color, points, radius;
 public:
-    Target(int x1, int y1, int s, int p, int r) 
-        : GameObject(x1, y1), speed(s), points(p), radius(r) {
-        dir = (rand() % 2) ? 1 : -1;
-        // Colorful targets - random bright colors
-        int colors[] = {RED, GREEN, BLUE, YELLOW, CYAN, MAGENTA, LIGHTRED, LIGHTGREEN, LIGHTBLUE, LIGHTCYAN, LIGHTMAGENTA};
-        color = colors[rand() % 11];
+    // Direction and color are chosen by the wave builder
+    Target(int x1, int y1, int s, int p, int r, int d, int c) 
+        : GameObject(x1, y1), speed(s), color(c), points(p), radius(r) {
+        vx = TO_FIX(d * speed * 13 / 10);  // 1.3x speed, whole units as before
     }
     
-    virtual void draw() {
-        setcolor(color);
+    virtual void draw(Renderer& r) {
+        int wx = FROM_FIX(x), wy = FROM_FIX(y);
+        r.setcolor(color);
         // Draw filled solid ball with no gaps
         for(int i = radius; i > 0; i--) {
-            circle(x, y, i);
+            r.circle(wx, wy, i);
         }
         
         // Add shiny highlight for 3D effect
-        setcolor(WHITE);
+        r.setcolor(WHITE);
         for(int i = radius/4; i > 0; i--) {
-            circle(x-radius/3, y-radius/3, i);
+            r.circle(wx-radius/3, wy-radius/3, i);
         }
     }
     
     void update() {
-        x += (int)(dir * speed * 1.3);
-        if(x <= 40 || x >= 600) {
-            dir *= -1;
+        int minX = TO_FIX(world.minX()), maxX = TO_FIX(world.maxX());
+        x += vx;
+        if(x <= minX || x >= maxX) {
+            vx = -vx;
             // Keep target within bounds
-            if(x < 40) x = 40;
-            if(x > 600) x = 600;
+            if(x < minX) x = minX;
+            if(x > maxX) x = maxX;
         }
     }
     
     bool hit(Bullet* b) {
         if(!b->isActive()) return false;
-        int dx = b->getX() - x;
-        int dy = b->getY() - y;
-        int hitRange = radius * radius;
+        long long dx = b->getX() - x;
+        long long dy = b->getY() - y;
+        long long hitRange = (long long)TO_FIX(radius) * TO_FIX(radius);
         if(dx*dx + dy*dy <= hitRange) {
             active = false;
             b->setActive(false);
@@ -169,37 +834,36 @@ public:
 // Fast Target - Polymorphism example
 class FastTarget : public Target {
 public:
-    FastTarget(int x1, int y1, int level) 
-        : Target(x1, y1, 4 + level, 20, 12) {
-        color = LIGHTRED;
-    }
+    FastTarget(int x1, int y1, int level, int d) 
+        : Target(x1, y1, 4 + level, 20, 12, d, LIGHTRED) {}
     
-    void draw() {
+    void draw(Renderer& r) {
+        int wx = FROM_FIX(x), wy = FROM_FIX(y);
         // Fast target - solid ball with motion blur effect
-        setcolor(LIGHTRED);
+        r.setcolor(LIGHTRED);
         for(int i = radius; i > 0; i--) {
-            circle(x, y, i);
+            r.circle(wx, wy, i);
         }
         
         // Triple speed lines for extra spice!
-        setcolor(YELLOW);
-        line(x-25, y, x-12, y);
-        line(x+12, y, x+25, y);
-        line(x-25, y-4, x-12, y-4);
-        line(x+12, y-4, x+25, y-4);
-        line(x-25, y+4, x-12, y+4);
-        line(x+12, y+4, x+25, y+4);
+        r.setcolor(YELLOW);
+        r.line(wx-25, wy, wx-12, wy);
+        r.line(wx+12, wy, wx+25, wy);
+        r.line(wx-25, wy-4, wx-12, wy-4);
+        r.line(wx+12, wy-4, wx+25, wy-4);
+        r.line(wx-25, wy+4, wx-12, wy+4);
+        r.line(wx+12, wy+4, wx+25, wy+4);
         
         // Glowing highlight
-        setcolor(WHITE);
+        r.setcolor(WHITE);
         for(int i = radius/4; i > 0; i--) {
-            circle(x-radius/3, y-radius/3, i);
+            r.circle(wx-radius/3, wy-radius/3, i);
         }
         
         // Add stars for extra spice
-        setcolor(YELLOW);
-        putpixel(x-radius-5, y, YELLOW);
-        putpixel(x+radius+5, y, YELLOW);
+        r.setcolor(YELLOW);
+        r.putpixel(wx-radius-5, wy, YELLOW);
+        r.putpixel(wx+radius+5, wy, YELLOW);
     }
 };
 
@@ -208,41 +872,40 @@ class BonusTarget : public Target {
 private:
     static int flashCounter;
 public:
-    BonusTarget(int x1, int y1) 
-        : Target(x1, y1, 3, 50, 18) {
-        color = GREEN;
-    }
+    BonusTarget(int x1, int y1, int d) 
+        : Target(x1, y1, 3, 50, 18, d, GREEN) {}
     
-    void draw() {
+    void draw(Renderer& r) {
+        int wx = FROM_FIX(x), wy = FROM_FIX(y);
         // Animated bonus target - filled solid ball with glow
         flashCounter = (flashCounter + 1) % 20;
         
-        if(flashCounter < 10) setcolor(GREEN);
-        else setcolor(LIGHTGREEN);
+        if(flashCounter < 10) r.setcolor(GREEN);
+        else r.setcolor(LIGHTGREEN);
         
         for(int i = radius; i > 0; i--) {
-            circle(x, y, i);
+            r.circle(wx, wy, i);
         }
         
         // Outer glow ring for extra spice
         if(flashCounter < 10) {
-            setcolor(LIGHTGREEN);
-            circle(x, y, radius+3);
-            circle(x, y, radius+2);
+            r.setcolor(LIGHTGREEN);
+            r.circle(wx, wy, radius+3);
+            r.circle(wx, wy, radius+2);
         }
         
         // Thick plus sign
-        setcolor(WHITE);
-        line(x-10, y, x+10, y);
-        line(x-10, y-1, x+10, y-1);
-        line(x-10, y+1, x+10, y+1);
-        line(x, y-10, x, y+10);
-        line(x-1, y-10, x-1, y+10);
-        line(x+1, y-10, x+1, y+10);
+        r.setcolor(WHITE);
+        r.line(wx-10, wy, wx+10, wy);
+        r.line(wx-10, wy-1, wx+10, wy-1);
+        r.line(wx-10, wy+1, wx+10, wy+1);
+        r.line(wx, wy-10, wx, wy+10);
+        r.line(wx-1, wy-10, wx-1, wy+10);
+        r.line(wx+1, wy-10, wx+1, wy+10);
         
         // Shiny highlight
         for(int i = radius/4; i > 0; i--) {
-            circle(x-radius/3, y-radius/3, i);
+            r.circle(wx-radius/3, wy-radius/3, i);
         }
     }
 };
@@ -254,56 +917,55 @@ class BombTarget : public Target {
 private:
     static int pulseCounter;
 public:
-    BombTarget(int x1, int y1, int level) 
-        : Target(x1, y1, 2 + level/3, -30, 20) {  // Negative points = penalty
-        color = RED;  // RED BOMB!
-    }
+    BombTarget(int x1, int y1, int level, int d) 
+        : Target(x1, y1, 2 + level/3, -30, 20, d, RED) {}  // Negative points = penalty, RED BOMB!
     
-    void draw() {
+    void draw(Renderer& r) {
+        int wx = FROM_FIX(x), wy = FROM_FIX(y);
         // Animated pulsing RED bomb - filled solid ball
         pulseCounter = (pulseCounter + 1) % 30;
         
         int pulseSize = (pulseCounter < 15) ? 0 : 3;
         
         // Draw filled red bomb
-        setcolor(RED);
+        r.setcolor(RED);
         for(int i = radius + pulseSize; i > 0; i--) {
-            circle(x, y, i);
+            r.circle(wx, wy, i);
         }
         
         // Danger glow ring - pulses
         if(pulseCounter < 15) {
-            setcolor(YELLOW);
-            circle(x, y, radius + pulseSize + 2);
-            circle(x, y, radius + pulseSize + 3);
+            r.setcolor(YELLOW);
+            r.circle(wx, wy, radius + pulseSize + 2);
+            r.circle(wx, wy, radius + pulseSize + 3);
         }
         
         // Sparking fuse on top - animated
         if(pulseCounter % 10 < 5) {
-            setcolor(YELLOW);
+            r.setcolor(YELLOW);
         } else {
-            setcolor(WHITE);
+            r.setcolor(WHITE);
         }
-        line(x, y-radius, x, y-radius-8);
+        r.line(wx, wy-radius, wx, wy-radius-8);
         // Spark effect
         for(int i = 4; i > 0; i--) {
-            circle(x, y-radius-10, i);
+            r.circle(wx, wy-radius-10, i);
         }
-        line(x-3, y-radius-10, x+3, y-radius-10);
-        line(x, y-radius-13, x, y-radius-7);
+        r.line(wx-3, wy-radius-10, wx+3, wy-radius-10);
+        r.line(wx, wy-radius-13, wx, wy-radius-7);
         
         // Skull symbol (danger!)
-        setcolor(YELLOW);
-        circle(x-3, y-2, 2);
-        circle(x+3, y-2, 2);
-        line(x-4, y+3, x-2, y+5);
-        line(x-2, y+5, x+2, y+5);
-        line(x+2, y+5, x+4, y+3);
+        r.setcolor(YELLOW);
+        r.circle(wx-3, wy-2, 2);
+        r.circle(wx+3, wy-2, 2);
+        r.line(wx-4, wy+3, wx-2, wy+5);
+        r.line(wx-2, wy+5, wx+2, wy+5);
+        r.line(wx+2, wy+5, wx+4, wy+3);
         
         // Dark highlight for 3D effect
-        setcolor(LIGHTRED);
+        r.setcolor(LIGHTRED);
         for(int i = radius/4; i > 0; i--) {
-            circle(x-radius/3, y-radius/3, i);
+            r.circle(wx-radius/3, wy-radius/3, i);
         }
     }
     
@@ -323,44 +985,45 @@ public:
         maxRadius = bomb ? 60 : 35;  // Even bigger explosion for bombs!
     }
     
-    void draw() {
+    void draw(Renderer& r) {
+        int wx = FROM_FIX(x), wy = FROM_FIX(y);
         if(isBombExplosion) {
             // MASSIVE dramatic explosion with shockwave!
-            setcolor(RED);
+            r.setcolor(RED);
             for(int i = 0; i < 3; i++) {
-                circle(x, y, radius + i);
+                r.circle(wx, wy, radius + i);
             }
             
-            setcolor(YELLOW);
+            r.setcolor(YELLOW);
             for(int i = 0; i < 3; i++) {
-                circle(x, y, radius - 8 + i);
+                r.circle(wx, wy, radius - 8 + i);
             }
             
-            setcolor(WHITE);
+            r.setcolor(WHITE);
             if(radius > 15) {
                 for(int i = 0; i < 2; i++) {
-                    circle(x, y, radius - 16 + i);
+                    r.circle(wx, wy, radius - 16 + i);
                 }
             }
             
             // Explosion rays for extra spice!
             if(frame % 3 == 0) {
-                setcolor(YELLOW);
+                r.setcolor(YELLOW);
                 for(int angle = 0; angle < 360; angle += 45) {
-                    int dx = (int)(radius * 0.7 * (angle % 90 == 0 ? 1 : 0.7));
-                    line(x, y, x + dx, y + dx);
+                    int dx = (angle % 90 == 0) ? radius * 7 / 10 : radius * 49 / 100;
+                    r.line(wx, wy, wx + dx, wy + dx);
                 }
             }
         } else {
             // Regular explosion - filled
-            setcolor(YELLOW);
+            r.setcolor(YELLOW);
             for(int i = radius; i > radius - 3; i--) {
-                circle(x, y, i);
+                r.circle(wx, wy, i);
             }
             if(radius > 3) {
-                setcolor(RED);
+                r.setcolor(RED);
                 for(int i = radius - 5; i > radius - 8 && i > 0; i--) {
-                    circle(x, y, i);
+                    r.circle(wx, wy, i);
                 }
             }
         }
@@ -373,6 +1036,159 @@ public:
     }
 };
 
+// Limits per tick for creating targets during a level transition
+#define SPAWN_BUDGET_US 500
+#define SPAWN_PER_TICK 2
+
+// Colorful targets - random bright colors
+const int targetColors[] = {RED, GREEN, BLUE, YELLOW, CYAN, MAGENTA, LIGHTRED, LIGHTGREEN, LIGHTBLUE, LIGHTCYAN, LIGHTMAGENTA};
+
+enum SpawnType { SPAWN_REGULAR, SPAWN_FAST, SPAWN_BONUS, SPAWN_BOMB };
+
+// Everything needed to create one target, decided ahead of time
+struct SpawnSpec {
+    int type, slot, level;
+    int x, y;        // Fixed-point world position
+    int dir, color;
+};
+
+// Builds the next wave's spawn list on a background thread while the
+// current level is played. When the level clears, the game takes the list
+// and creates a few targets per tick instead of all of them at once.
+// The builder thread lives as long as the scheduler and is woken with a
+// condition variable, so no thread is started or joined mid-game.
+class WaveScheduler {
+    vector<SpawnSpec> built;     // Written only by the builder while !ready
+    vector<SpawnSpec> pending;   // Wave currently spawning
+    size_t cursor;               // Next spec in pending
+    mutex lock;
+    condition_variable wake;
+    int requestLevel;            // Level for the builder to build, 0 if none
+    unsigned requestSeed;
+    bool ready, quit;
+    bool requested;              // A wave has been asked for since the last start()
+    int transitions;
+    double worstTransitionMs, worstFrameMs;
+    thread builder;
+    
+    void builderLoop() {
+        unique_lock<mutex> l(lock);
+        while(true) {
+            wake.wait(l, [&] { return quit || requestLevel > 0; });
+            if(quit) return;
+            int level = requestLevel;
+            unsigned seed = requestSeed;
+            requestLevel = 0;
+            
+            l.unlock();
+            build(&built, level, seed);
+            l.lock();
+            
+            ready = true;
+            wake.notify_all();
+        }
+    }
+    
+    // Own generator so the builder never touches rand() from another thread
+    static int nextRand(unsigned& seed) {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 16) & 0x7fff;
+    }
+    
+    static void add(vector<SpawnSpec>& wave, int type, int slot, int level, int x, int y, unsigned& seed) {
+        SpawnSpec s = { type, slot, level, TO_FIX(x), TO_FIX(y), 0, 0 };
+        s.dir = (nextRand(seed) % 2) ? 1 : -1;
+        s.color = targetColors[nextRand(seed) % 11];
+        wave.push_back(s);
+    }
+    
+    static void build(vector<SpawnSpec>* wave, int level, unsigned seed) {
+        wave->clear();
+        
+        // Regular targets with higher speed even at level 1
+        for(int i = 0; i < 3; i++) {
+            add(*wave, SPAWN_REGULAR, i, level,
+                80 + nextRand(seed) % (world.width - 160), 60 + i*70, seed);
+        }
+        
+        // Fast targets (polymorphism)
+        if(level >= 2) {
+            add(*wave, SPAWN_FAST, 3, level,
+                100 + nextRand(seed) % (world.width - 240), 150, seed);
+        }
+        
+        // Bonus target
+        if(level >= 2 && nextRand(seed) % 3 == 0) {
+            add(*wave, SPAWN_BONUS, 4, level,
+                world.width / 2 - 120 + nextRand(seed) % 200, 100, seed);
+        }
+        
+        // Bomb targets from level 3 - DANGEROUS!
+        if(level >= 3) {
+            int numBombs = 1 + (level - 3) / 2;  // More bombs at higher levels
+            if(numBombs > 3) numBombs = 3;
+            
+            for(int i = 0; i < numBombs; i++) {
+                int x = 100 + nextRand(seed) % (world.width - 240);
+                add(*wave, SPAWN_BOMB, 5 + i, level, x, 80 + nextRand(seed) % 150, seed);
+            }
+        }
+    }
+    
+public:
+    WaveScheduler()
+        : cursor(0), requestLevel(0), requestSeed(0), ready(false), quit(false),
+          requested(false), transitions(0), worstTransitionMs(0), worstFrameMs(0),
+          builder(&WaveScheduler::builderLoop, this) {}
+    
+    // Ask the builder for a level's wave
+    void prepare(int level) {
+        requested = true;
+        {
+            lock_guard<mutex> l(lock);
+            ready = false;
+            requestLevel = level;
+            requestSeed = rand();
+        }
+        wake.notify_all();
+    }
+    
+    // Switch to the prepared wave. It was built during the level, so this
+    // normally does not wait.
+    void start() {
+        unique_lock<mutex> l(lock);
+        wake.wait(l, [&] { return ready; });
+        pending.swap(built);
+        cursor = 0;
+        requested = false;
+    }
+    
+    bool isSpawning() { return cursor < pending.size(); }
+    bool isRequested() { return requested; }
+    const SpawnSpec& next() { return pending[cursor++]; }
+    
+    // Track frame times (update and draw), separating frames that spawned targets
+    void recordFrame(double ms, bool transition) {
+        if(transition) {
+            transitions++;
+            if(ms > worstTransitionMs) worstTransitionMs = ms;
+        } else if(ms > worstFrameMs) {
+            worstFrameMs = ms;
+        }
+    }
+    
+    ~WaveScheduler() {
+        {
+            lock_guard<mutex> l(lock);
+            quit = true;
+        }
+        wake.notify_all();
+        builder.join();
+        fprintf(stderr, "Waves: %d spawn frames, worst spawn frame %.3f ms, worst other frame %.3f ms\n",
+                transitions, worstTransitionMs, worstFrameMs);
+    }
+};
+
 // File handler for high score
 class ScoreManager {
     const char* filename;
@@ -408,60 +1224,85 @@ class Game {
     bool paused, gameOver;
     ScoreManager scoreManager;
     int frameCount;
+    Renderer renderer;
+    FrameCapture* capture;  // NULL unless recording
+    WaveScheduler waves;
+    chrono::steady_clock::time_point frameStart;
+    bool spawnedThisFrame;
     
 public:
-    Game() : gun(320, 450), score(0), bulletsLeft(20), level(1), 
-             paused(false), gameOver(false), frameCount(0) {
+    Game(int threads, int resW, int resH, const char* capturePath, bool batching)
+           : gun(TO_FIX(world.width / 2), TO_FIX(world.height - 30)), score(0), bulletsLeft(20), level(1), 
+             paused(false), gameOver(false), frameCount(0),
+             renderer(resW, resH, threads, world.width, world.height), capture(NULL),
+             frameStart(chrono::steady_clock::now()), spawnedThisFrame(false) {
         for(int i = 0; i < 30; i++) bullets[i] = NULL;
         for(int i = 0; i < 8; i++) targets[i] = NULL;
         for(int i = 0; i < 10; i++) explosions[i] = NULL;
         
         highScore = scoreManager.loadHighScore();
-        spawnTargets();
+        renderer.setBatching(batching);
+        
+        // First wave is built up front and spawned in one go
+        waves.prepare(level);
+        waves.start();
+        spawnTargets(false);
+        
+        if(capturePath) {
+            capture = new FrameCapture(capturePath, resW, resH);
+            if(!capture->isOpen()) {
+                fprintf(stderr, "Could not open capture output: %s\n", capturePath);
+                delete capture;
+                capture = NULL;
+            }
+        }
     }
     
     ~Game() {
         for(int i = 0; i < 30; i++) if(bullets[i]) delete bullets[i];
         for(int i = 0; i < 8; i++) if(targets[i]) delete targets[i];
         for(int i = 0; i < 10; i++) if(explosions[i]) delete explosions[i];
+        if(capture) delete capture;
+        renderer.printStats();
         
         if(score > highScore) {
             scoreManager.saveHighScore(score);
         }
     }
     
-    void spawnTargets() {
-        // Clear old targets
-        for(int i = 0; i < 8; i++) {
-            if(targets[i]) delete targets[i];
-            targets[i] = NULL;
-        }
-        
-        // Spawn regular targets with higher speed even at level 1
-        for(int i = 0; i < 3; i++) {
-            targets[i] = new Target(80 + rand() % 480, 60 + i*70, 
-                                   5 + level, 10, 15);  // Higher base speed: 5 + level
-        }
-        
-        // Spawn fast targets (polymorphism)
-        if(level >= 2) {
-            targets[3] = new FastTarget(100 + rand() % 400, 150, level);
-        }
-        
-        // Spawn bonus target
-        if(level >= 2 && rand() % 3 == 0) {
-            targets[4] = new BonusTarget(200 + rand() % 200, 100);
+    Target* createTarget(const SpawnSpec& s) {
+        switch(s.type) {
+        case SPAWN_FAST:
+            return new FastTarget(s.x, s.y, s.level, s.dir);
+        case SPAWN_BONUS:
+            return new BonusTarget(s.x, s.y, s.dir);
+        case SPAWN_BOMB:
+            return new BombTarget(s.x, s.y, s.level, s.dir);
+        default:
+            // Higher base speed: 5 + level
+            return new Target(s.x, s.y, 5 + s.level, 10, 15, s.dir, s.color);
         }
+    }
+    
+    // Create targets from the current wave, stopping after SPAWN_PER_TICK
+    // targets or once the tick's time budget is used up, so a wave streams in
+    // over several ticks. Returns true if anything was spawned.
+    bool spawnTargets(bool budgeted) {
+        if(!waves.isSpawning()) return false;
         
-        // Spawn bomb targets from level 3 - DANGEROUS!
-        if(level >= 3) {
-            int numBombs = 1 + (level - 3) / 2;  // More bombs at higher levels
-            if(numBombs > 3) numBombs = 3;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        int spawned = 0;
+        while(waves.isSpawning()) {
+            const SpawnSpec& s = waves.next();
+            if(targets[s.slot]) delete targets[s.slot];
+            targets[s.slot] = createTarget(s);
+            spawned++;
             
-            for(int i = 0; i < numBombs; i++) {
-                targets[5 + i] = new BombTarget(100 + rand() % 400, 80 + rand() % 150, level);
-            }
+            if(budgeted && (spawned >= SPAWN_PER_TICK ||
+                            chrono::steady_clock::now() - start >= chrono::microseconds(SPAWN_BUDGET_US)))
+                break;
         }
+        return true;
     }
     
     void addExplosion(int x, int y, bool isBomb = false) {
@@ -479,7 +1320,7 @@ public:
         for(int i = 0; i < 30; i++) {
             if(!bullets[i] || !bullets[i]->isActive()) {
                 if(bullets[i]) delete bullets[i];
-                bullets[i] = new Bullet(gun.getX(), gun.getY()-30);
+                bullets[i] = new Bullet(gun.getX(), gun.getY() - TO_FIX(30));
                 bulletsLeft--;
                 return;
             }
@@ -487,6 +1328,10 @@ public:
     }
     
     void update() {
+        // Frame time runs from here to the end of draw()
+        frameStart = chrono::steady_clock::now();
+        spawnedThisFrame = false;
+        
         if(paused || gameOver) return;
         
         frameCount++;
@@ -533,12 +1378,17 @@ public:
             }
         }
         
-        // Next level
-        if(activeTargets == 0 && gun.getLives() > 0) {
+        // Next level - wait until the previous wave has fully spawned
+        if(activeTargets == 0 && gun.getLives() > 0 && !waves.isSpawning()) {
             level++;
             bulletsLeft += 15;
-            spawnTargets();
+            waves.start();
         }
+        spawnedThisFrame = spawnTargets(true);
+        
+        // Ask for the next wave on the first ordinary tick after this one is
+        // in, keeping the request off the transition ticks
+        if(!spawnedThisFrame && !waves.isRequested()) waves.prepare(level + 1);
         
         // Game over
         if(gun.getLives() <= 0 || (bulletsLeft <= 0 && activeTargets > 0)) {
@@ -548,90 +1398,104 @@ public:
     
     void drawBackground() {
         // Draw border
-        setcolor(CYAN);
-        rectangle(10, 10, 630, 470);
-        rectangle(11, 11, 629, 469);
+        renderer.setcolor(CYAN);
+        renderer.rectangle(10, 10, world.width - 10, world.height - 10);
+        renderer.rectangle(11, 11, world.width - 11, world.height - 11);
         
         // Draw stars
-        setcolor(WHITE);
+        renderer.setcolor(WHITE);
         for(int i = 0; i < 30; i++) {
-            int sx = 20 + (i * 37) % 600;
-            int sy = 20 + (i * 43) % 400;
-            putpixel(sx, sy, WHITE);
+            int sx = 20 + (i * 37) % (world.width - 40);
+            int sy = 20 + (i * 43) % (world.height - 80);
+            renderer.putpixel(sx, sy, WHITE);
         }
     }
     
     void drawHUD() {
         char text[50];
+        int cx = world.width / 2, cy = world.height / 2;
         
         // Score and stats
-        setcolor(WHITE);
+        renderer.setcolor(WHITE);
         sprintf(text, "Score: %d", score);
-        outtextxy(20, 20, text);
+        renderer.outtextxy(20, 20, text);
         
         sprintf(text, "Level: %d", level);
-        outtextxy(20, 35, text);
+        renderer.outtextxy(20, 35, text);
         
         sprintf(text, "Bullets: %d", bulletsLeft);
-        outtextxy(520, 20, text);
+        renderer.outtextxy(world.width - 120, 20, text);
         
         sprintf(text, "High: %d", highScore);
-        outtextxy(520, 35, text);
+        renderer.outtextxy(world.width - 120, 35, text);
         
         // Lives display (hearts)
-        setcolor(RED);
+        renderer.setcolor(RED);
         for(int i = 0; i < gun.getLives(); i++) {
-            circle(250 + i*25, 25, 8);
-            circle(250 + i*25, 25, 6);
+            renderer.circle(cx - 70 + i*25, 25, 8);
+            renderer.circle(cx - 70 + i*25, 25, 6);
         }
         
         // Pause indicator
         if(paused) {
-            setcolor(YELLOW);
-            outtextxy(280, 220, (char*)"PAUSED");
-            outtextxy(230, 250, (char*)"Press P to resume");
+            renderer.setcolor(YELLOW);
+            renderer.outtextxy(cx - 40, cy - 20, (char*)"PAUSED");
+            renderer.outtextxy(cx - 90, cy + 10, (char*)"Press P to resume");
         }
     }
     
     void draw() {
-        cleardevice();
+        // Record this frame's draw commands
+        renderer.begin();
         
         drawBackground();
         drawHUD();
         
         // Draw game objects
-        gun.draw();
+        gun.draw(renderer);
         
         for(int i = 0; i < 30; i++)
             if(bullets[i] && bullets[i]->isActive())
-                bullets[i]->draw();
+                bullets[i]->draw(renderer);
         
         for(int i = 0; i < 8; i++)
             if(targets[i] && targets[i]->isActive())
-                targets[i]->draw();
+                targets[i]->draw(renderer);
         
         for(int i = 0; i < 10; i++)
             if(explosions[i] && explosions[i]->isActive())
-                explosions[i]->draw();
+                explosions[i]->draw(renderer);
         
         // Game over screen
         if(gameOver) {
             char text[50];
-            setcolor(RED);
-            outtextxy(220, 200, (char*)"GAME OVER!");
+            int cx = world.width / 2, cy = world.height / 2;
+            renderer.setcolor(RED);
+            renderer.outtextxy(cx - 100, cy - 40, (char*)"GAME OVER!");
             
-            setcolor(YELLOW);
+            renderer.setcolor(YELLOW);
             sprintf(text, "Final Score: %d", score);
-            outtextxy(250, 240, text);
+            renderer.outtextxy(cx - 70, cy, text);
             
             if(score >= highScore) {
-                setcolor(GREEN);
-                outtextxy(230, 260, (char*)"NEW HIGH SCORE!");
+                renderer.setcolor(GREEN);
+                renderer.outtextxy(cx - 90, cy + 20, (char*)"NEW HIGH SCORE!");
             }
             
-            setcolor(WHITE);
-            outtextxy(210, 290, (char*)"Press Q to exit");
+            renderer.setcolor(WHITE);
+            renderer.outtextxy(cx - 110, cy + 50, (char*)"Press Q to exit");
         }
+        
+        // Rasterize tiles in parallel, then show the finished frame
+        renderer.render();
+        cleardevice();
+        renderer.present();
+        
+        // After present() - capture takes the frame buffer away
+        if(capture) capture->submit(renderer);
+        
+        waves.recordFrame(chrono::duration<double, milli>(chrono::steady_clock::now() - frameStart).count(),
+                          spawnedThisFrame);
     }
     
     void processKeys(char key) {
@@ -665,7 +1529,112 @@ public:
     bool isRunning() { return !gameOver; }
 };
 
-int main() {
+// Average render and present time per frame for a swarm. There is no window
+// here, so present() is stood in for by a copy of every lit pixel - the same
+// single-threaded scan the game does.
+void timeFrames(Renderer& r, vector<GameObject*>& swarm, int frames, double& renderMs, double& presentMs) {
+    int w = r.getWidth(), h = r.getHeight();
+    vector<unsigned char> screen(w * h);
+    renderMs = presentMs = 0;
+    for(int f = 0; f < frames; f++) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        r.begin();
+        for(size_t i = 0; i < swarm.size(); i++) swarm[i]->draw(r);
+        r.render();
+        chrono::steady_clock::time_point rendered = chrono::steady_clock::now();
+        r.blit([&](int x, int y, int c) { screen[y * w + x] = c; }, w, h);
+        chrono::steady_clock::time_point presented = chrono::steady_clock::now();
+        renderMs += chrono::duration<double, milli>(rendered - start).count();
+        presentMs += chrono::duration<double, milli>(presented - rendered).count();
+    }
+    renderMs /= frames;
+    presentMs /= frames;
+}
+
+// Headless benchmark - render a swarm of objects with 1..maxThreads threads,
+// then compare batching off and on at maxThreads
+void benchRender(int maxThreads, int resW, int resH) {
+    int counts[] = { 100, 1000, 5000 };
+    const int frames = 30;
+    
+    printf("World %dx%d rendered at %dx%d\n", world.width, world.height, resW, resH);
+    printf("%8s %8s %10s %10s %10s %8s\n", "objects", "threads", "render ms", "present ms", "frame ms", "speedup");
+    for(int n = 0; n < 3; n++) {
+        // Mixed swarm of every drawable type
+        srand(1);
+        vector<GameObject*> swarm;
+        for(int i = 0; i < counts[n]; i++) {
+            int x = TO_FIX(rand() % world.width), y = TO_FIX(rand() % world.height);
+            switch(i % 5) {
+            case 0: swarm.push_back(new Target(x, y, 5, 10, 15, 1, targetColors[i % 11])); break;
+            case 1: swarm.push_back(new FastTarget(x, y, 2, 1)); break;
+            case 2: swarm.push_back(new BonusTarget(x, y, 1)); break;
+            case 3: swarm.push_back(new BombTarget(x, y, 3, 1)); break;
+            case 4: swarm.push_back(new Explosion(x, y, i % 2 == 0)); break;
+            }
+        }
+        
+        double base = 0;
+        for(int t = 1; t <= maxThreads; t++) {
+            Renderer r(resW, resH, t, world.width, world.height);
+            double renderMs, presentMs;
+            timeFrames(r, swarm, frames, renderMs, presentMs);
+            double ms = renderMs + presentMs;
+            if(t == 1) base = ms;
+            printf("%8d %8d %10.3f %10.3f %10.3f %7.2fx\n", counts[n], t, renderMs, presentMs, ms, base / ms);
+        }
+        
+        for(int batching = 0; batching <= 1; batching++) {
+            Renderer r(resW, resH, maxThreads, world.width, world.height);
+            r.setBatching(batching);
+            double renderMs, presentMs;
+            timeFrames(r, swarm, frames, renderMs, presentMs);
+            const RenderStats& st = r.getStats();
+            printf("%17s  batching %-3s render %.3f ms, %d primitives in %d raster calls, "
+                   "color changes %d -> %d\n", "", batching ? "on" : "off", renderMs,
+                   st.cmds, st.calls, st.colorChanges, st.renderColorChanges);
+        }
+        
+        for(size_t i = 0; i < swarm.size(); i++) delete swarm[i];
+    }
+}
+
+int main(int argc, char* argv[]) {
+    // Render threads default to one per core, resolution to the window size
+    int cores = max(1, (int)thread::hardware_concurrency());
+    int threads = cores;
+    int resW = 0, resH = 0;
+    const char* capturePath = NULL;
+    bool bench = false, batching = false;
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "--threads") && i + 1 < argc) threads = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--world") && i + 1 < argc) sscanf(argv[++i], "%dx%d", &world.width, &world.height);
+        else if(!strcmp(argv[i], "--res") && i + 1 < argc) sscanf(argv[++i], "%dx%d", &resW, &resH);
+        else if(!strcmp(argv[i], "--capture") && i + 1 < argc) capturePath = argv[++i];
+        else if(!strcmp(argv[i], "--batch")) batching = true;
+        else if(!strcmp(argv[i], "--bench-render")) bench = true;
+    }
+    // Past a few threads per core, extra threads only add switching
+    if(threads < 1) threads = 1;
+    if(threads > 4 * cores) threads = 4 * cores;
+    
+    // Spawn and HUD layout need at least 320x240. Up to 8192x8192 keeps
+    // fixed-point coordinates in range and the render scale above zero.
+    if(world.width < 320) world.width = 320;
+    if(world.height < 240) world.height = 240;
+    if(world.width > 8192) world.width = 8192;
+    if(world.height > 8192) world.height = 8192;
+    
+    // Up to 4K output
+    if(resW > 3840) resW = 3840;
+    if(resH > 2160) resH = 2160;
+    
+    if(bench) {
+        if(resW <= 0 || resH <= 0) { resW = 640; resH = 480; }
+        benchRender(threads, resW, resH);
+        return 0;
+    }
+    
     int gd = DETECT, gm;
     initgraph(&gd, &gm, (char*)"");
     srand(time(0));
@@ -704,7 +1673,11 @@ int main() {
         }
     } while(1);
     
-    Game game;
+    if(resW <= 0 || resH <= 0) {
+        resW = getmaxx() + 1;
+        resH = getmaxy() + 1;
+    }
+    Game game(threads, resW, resH, capturePath, batching);
     
     // Main game loop
     while(game.isRunning()) {